@@ -0,0 +1,425 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// For memfd_create
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+// Identifies a cache file. It is written in host
+// byte order, so a cache file written on a host
+// of the other endianness is treated as a miss.
+#define CACHE_MAGIC 0x4D434348
+
+// Header at the start of every cache file. The
+// binary follows, so that a hit can be checked
+// against it, and the decoded memory follows at
+// offset, which is a multiple of the page size
+// so it can be mapped.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;          // Hash of the binary
+    uint32_t len;           // Length of the binary
+    uint32_t memory_size;   // Words of decoded memory
+    uint32_t entry;         // Initial program counter
+    uint32_t offset;        // File offset of decoded memory
+} cacheHeader;
+
+// Every instance maps the same file, so pages
+// which are never written are only in memory once.
+// While the first instance of a binary decodes it,
+// its image is a claim with no file, and the other
+// instances wait for it rather than decoding too.
+struct sharedImage {
+    sharedImage *next;
+    cacheHeader header;
+    int fd;                     // Image file, or -1 for a claim
+    const unsigned char *bin;   // Binary being decoded, for a claim
+    int refs;
+};
+
+// Images shared within this process
+static sharedImage *sharedImages;
+static pthread_mutex_t sharedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sharedReady = PTHREAD_COND_INITIALIZER;
+
+uint64_t hashBinary(const unsigned char *bin, uint32_t len);
+char *cachePath(const char *dir, uint64_t hash, uint32_t len);
+bool matchesBinary(int fd, const unsigned char *bin, uint32_t len);
+int openCacheFile(const char *dir, const unsigned char *bin, uint32_t len, uint64_t hash,
+                  cacheHeader *h);
+bool writeImage(int fd, const cacheHeader *h, const unsigned char *bin, const uint32_t *memory);
+int writeCacheFile(const char *dir, const cacheHeader *h, const unsigned char *bin,
+                   const uint32_t *memory);
+bool mapImage(int fd, const cacheHeader *h, sharedImage *image, cacheMapping *mp);
+bool shareImage(int fd, const cacheHeader *h, sharedImage *claim, cacheMapping *mp);
+sharedImage *findImage(const unsigned char *bin, uint32_t len, uint64_t hash);
+void dropClaim(cacheMapping *mp);
+
+// Hashes four independent lanes of words at a time, each
+// multiplied like a 64-bit FNV-1a over words instead of
+// bytes, then folds the lanes together. Hits are checked
+// against the stored binary, so the hash only has to spread
+// binaries across file names, and it must cost much less
+// than decoding the binary.
+uint64_t hashBinary(const unsigned char *bin, uint32_t len) {
+    uint64_t lanes[4] = {0xcbf29ce484222325ULL ^ len, 1, 2, 3};
+    uint32_t i = 0;
+    for (; i + sizeof(lanes) <= len; i += sizeof(lanes)) {
+        uint64_t words[4];
+        memcpy(words, bin + i, sizeof(words));
+        lanes[0] = (lanes[0] ^ words[0]) * 0x9E3779B97F4A7C15ULL;
+        lanes[1] = (lanes[1] ^ words[1]) * 0x9E3779B97F4A7C15ULL;
+        lanes[2] = (lanes[2] ^ words[2]) * 0x9E3779B97F4A7C15ULL;
+        lanes[3] = (lanes[3] ^ words[3]) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // Multiplying only carries bits upwards,
+    // so fold the high bits back down
+    uint64_t hash = 0;
+    for (int j = 0; j < 4; j++) {
+        hash = (hash ^ lanes[j]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < len; i++) {
+        hash ^= bin[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// Returns a malloc'd path, or NULL
+char *cachePath(const char *dir, uint64_t hash, uint32_t len) {
+    size_t size = strlen(dir) + 64;
+    char *path = (char*)malloc(size);
+    if (path == NULL)
+        return NULL;
+    snprintf(path, size, "%s/%016llx-%08x.img", dir, (unsigned long long)hash, len);
+    return path;
+}
+
+// Reports whether the binary stored in an image is
+// bin. The hash only picks the file or shared image,
+// and two binaries of the same length can share it.
+bool matchesBinary(int fd, const unsigned char *bin, uint32_t len) {
+    size_t length = sizeof(cacheHeader) + (size_t)len;
+    void *stored = mmap(NULL, length, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (stored == MAP_FAILED)
+        return false;
+    bool match = memcmp((unsigned char*)stored + sizeof(cacheHeader), bin, len) == 0;
+    munmap(stored, length);
+    return match;
+}
+
+// Opens and validates the cache file for a binary,
+// reading its header into h. Returns -1 on a miss.
+int openCacheFile(const char *dir, const unsigned char *bin, uint32_t len, uint64_t hash,
+                  cacheHeader *h) {
+    char *path = cachePath(dir, hash, len);
+    if (path == NULL)
+        return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    long page = sysconf(_SC_PAGESIZE);
+    if (pread(fd, h, sizeof(*h), 0) != sizeof(*h) || fstat(fd, &st) != 0 ||
+        h->magic != CACHE_MAGIC || h->version != CACHE_VERSION ||
+        h->hash != hash || h->len != len || h->memory_size == 0 ||
+        page <= 0 || h->offset % page != 0 || h->offset < sizeof(*h) + (uint64_t)len ||
+        (uint64_t)st.st_size < (uint64_t)h->offset + (uint64_t)h->memory_size * 4 ||
+        !matchesBinary(fd, bin, len)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes the header, binary and memory of an image to fd
+bool writeImage(int fd, const cacheHeader *h, const unsigned char *bin, const uint32_t *memory) {
+    size_t length = (size_t)h->memory_size * 4;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (ftruncate(fd, (off_t)h->offset + (off_t)length) != 0 ||
+        pwrite(fd, h, sizeof(*h), 0) != sizeof(*h) ||
+        pwrite(fd, bin, h->len, sizeof(*h)) != (ssize_t)h->len)
+        return false;
+
+    // Only write pages which are not entirely zero;
+    // the rest stay holes in a sparse file
+    const unsigned char *bytes = (const unsigned char*)memory;
+    for (size_t off = 0; off < length; off += page) {
+        size_t n = length - off < page ? length - off : page;
+        bool zero = true;
+        for (size_t i = 0; i < n / 4; i++) {
+            if (memory[off / 4 + i] != 0) {
+                zero = false;
+                break;
+            }
+        }
+        if (!zero && pwrite(fd, bytes + off, n, (off_t)h->offset + (off_t)off) != (ssize_t)n)
+            return false;
+    }
+    return true;
+}
+
+// Writes the cache file for an image, returning
+// it open for reading, or -1 on failure
+int writeCacheFile(const char *dir, const cacheHeader *h, const unsigned char *bin,
+                   const uint32_t *memory) {
+    char *path = cachePath(dir, h->hash, h->len);
+    if (path == NULL)
+        return -1;
+
+    // Write to a new temporary file and rename it into
+    // place so that readers never see a partial file.
+    // Each write gets its own file, since another
+    // writer's may already be renamed and mapped.
+    size_t tmpSize = strlen(path) + 8;
+    char *tmp = (char*)malloc(tmpSize);
+    if (tmp == NULL) {
+        free(path);
+        return -1;
+    }
+    snprintf(tmp, tmpSize, "%s.XXXXXX", path);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    bool created = fd >= 0;
+    bool ok = created && fchmod(fd, 0644) == 0 && writeImage(fd, h, bin, memory);
+    if (created && !ok) {
+        close(fd);
+        fd = -1;
+    }
+    if (ok && rename(tmp, path) != 0) {
+        close(fd);
+        fd = -1;
+        ok = false;
+    }
+    if (!ok) {
+        #ifdef DEBUG
+            fprintf(stderr, "Could not write cache file: %s\n", path);
+        #endif
+        if (created)
+            unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    return fd;
+}
+
+// Maps the memory of an image privately, so that
+// writes by the guest never reach the file
+bool mapImage(int fd, const cacheHeader *h, sharedImage *image, cacheMapping *mp) {
+    size_t length = (size_t)h->memory_size * 4;
+    void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, h->offset);
+    if (memory == MAP_FAILED)
+        return false;
+
+    mp->memory = (uint32_t*)memory;
+    mp->memory_size = h->memory_size;
+    mp->entry = h->entry;
+    mp->length = length;
+    mp->image = image;
+    return true;
+}
+
+// Maps an image and registers it so that later instances
+// in this process share it, completing claim if it is not
+// NULL. Takes ownership of fd.
+bool shareImage(int fd, const cacheHeader *h, sharedImage *claim, cacheMapping *mp) {
+    sharedImage *image = claim;
+    if (image == NULL)
+        image = (sharedImage*)malloc(sizeof(*image));
+    if (image == NULL || !mapImage(fd, h, image, mp)) {
+        close(fd);
+        if (claim == NULL)
+            free(image);
+        mp->image = claim;
+        dropClaim(mp);
+        return false;
+    }
+
+    pthread_mutex_lock(&sharedLock);
+    image->header = *h;
+    image->fd = fd;
+    image->bin = NULL;
+    image->refs = 1;
+    if (claim == NULL) {
+        image->next = sharedImages;
+        sharedImages = image;
+    }
+    pthread_cond_broadcast(&sharedReady);
+    pthread_mutex_unlock(&sharedLock);
+    return true;
+}
+
+// Returns the image or claim for bin, or NULL.
+// Must be called with sharedLock held.
+sharedImage *findImage(const unsigned char *bin, uint32_t len, uint64_t hash) {
+    for (sharedImage *image = sharedImages; image != NULL; image = image->next) {
+        if (image->header.hash != hash || image->header.len != len)
+            continue;
+        if (image->fd < 0 ? memcmp(image->bin, bin, len) == 0 : matchesBinary(image->fd, bin, len))
+            return image;
+    }
+    return NULL;
+}
+
+// Removes the claim left in mp by cacheLoad, if any,
+// and wakes the instances waiting on it so that one
+// of them can claim the binary instead
+void dropClaim(cacheMapping *mp) {
+    sharedImage *claim = mp->image;
+    if (claim == NULL)
+        return;
+    mp->image = NULL;
+
+    pthread_mutex_lock(&sharedLock);
+    sharedImage **p = &sharedImages;
+    while (*p != claim)
+        p = &(*p)->next;
+    *p = claim->next;
+    free(claim);
+    pthread_cond_broadcast(&sharedReady);
+    pthread_mutex_unlock(&sharedLock);
+}
+
+bool cacheLoad(const char *dir, bool share, const unsigned char *bin, uint32_t len,
+               cacheMapping *mp) {
+    uint64_t hash = hashBinary(bin, len);
+    sharedImage *claim = NULL;
+
+    if (share) {
+        pthread_mutex_lock(&sharedLock);
+        sharedImage *image;
+        while ((image = findImage(bin, len, hash)) != NULL && image->fd < 0)
+            pthread_cond_wait(&sharedReady, &sharedLock);
+        if (image != NULL && mapImage(image->fd, &image->header, image, mp)) {
+            image->refs++;
+            pthread_mutex_unlock(&sharedLock);
+            return true;
+        }
+
+        // Claim the binary, so that other instances
+        // wait for this one to decode and store it
+        if (image == NULL)
+            claim = (sharedImage*)calloc(1, sizeof(*claim));
+        if (claim != NULL) {
+            claim->header.hash = hash;
+            claim->header.len = len;
+            claim->fd = -1;
+            claim->bin = bin;
+            claim->next = sharedImages;
+            sharedImages = claim;
+        }
+        pthread_mutex_unlock(&sharedLock);
+    }
+
+    mp->image = claim;
+    if (dir == NULL)
+        return false;
+
+    cacheHeader h;
+    int fd = openCacheFile(dir, bin, len, hash, &h);
+    if (fd < 0)
+        return false;
+    if (share)
+        return shareImage(fd, &h, claim, mp);
+
+    bool ok = mapImage(fd, &h, NULL, mp);
+    close(fd);
+    return ok;
+}
+
+void cacheAbandon(cacheMapping *mp) {
+    dropClaim(mp);
+}
+
+bool cacheStore(const char *dir, bool share, const unsigned char *bin, uint32_t len,
+                const uint32_t *memory, uint32_t memory_size, uint32_t entry,
+                cacheMapping *mp) {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t offset = page > 0 ? ((uint64_t)sizeof(cacheHeader) + len + page - 1) / page * page : 0;
+    if (memory_size == 0 || page <= 0 || offset > UINT32_MAX) {
+        dropClaim(mp);
+        return false;
+    }
+
+    cacheHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CACHE_MAGIC;
+    h.version = CACHE_VERSION;
+    h.hash = hashBinary(bin, len);
+    h.len = len;
+    h.memory_size = memory_size;
+    h.entry = entry;
+    h.offset = (uint32_t)offset;
+
+    int fd = -1;
+    if (dir != NULL) {
+        fd = writeCacheFile(dir, &h, bin, memory);
+        if (fd >= 0 && !share) {
+            close(fd);
+            return false;
+        }
+    }
+
+    if (!share)
+        return false;
+
+    // Without a cache file, share the
+    // image through an anonymous file
+    if (fd < 0) {
+        fd = memfd_create("machine-image", MFD_CLOEXEC);
+        if (fd >= 0 && !writeImage(fd, &h, bin, memory)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        dropClaim(mp);
+        return false;
+    }
+    return shareImage(fd, &h, mp->image, mp);
+}
+
+void cacheRestore(cacheMapping *mp, uint32_t addr, uint32_t size) {
+    // Dropping the private copies of pages in a private
+    // file mapping makes later accesses read the file again
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)addr * 4 / page * page;
+    madvise((unsigned char*)mp->memory + start, (size_t)addr * 4 + (size_t)size * 4 - start, MADV_DONTNEED);
+}
+
+void cacheRelease(cacheMapping *mp) {
+    munmap(mp->memory, mp->length);
+
+    sharedImage *image = mp->image;
+    if (image == NULL)
+        return;
+
+    // Drop the image once the last instance using it is done
+    pthread_mutex_lock(&sharedLock);
+    if (--image->refs == 0) {
+        sharedImage **p = &sharedImages;
+        while (*p != image)
+            p = &(*p)->next;
+        *p = image->next;
+        close(image->fd);
+        free(image);
+    }
+    pthread_mutex_unlock(&sharedLock);
+}
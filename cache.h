@@ -0,0 +1,65 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CACHE_INC
+#define CACHE_INC
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bump whenever the decoded form of an image
+// changes so that stale cache entries are ignored
+#define CACHE_VERSION 3
+
+// A decoded image shared by every instance
+// in the process which runs the same binary
+typedef struct sharedImage sharedImage;
+
+// Decoded memory mapped copy-on-write from
+// a cache file or a shared image
+typedef struct {
+    uint32_t *memory;
+    uint32_t memory_size;
+    uint32_t entry;         // Initial program counter
+    size_t length;          // Length of the mapping
+    sharedImage *image;     // Image mapped from, or NULL
+} cacheMapping;
+
+// Looks up the decoded memory of bin, first among the
+// images shared in this process (if share is set) and
+// then in the cache directory dir (if it is not NULL).
+// On a hit, maps the memory into mp and returns true.
+// If share is set, a miss leaves a claim on bin in mp,
+// and later lookups of bin in this process wait until
+// it is passed to cacheStore or cacheAbandon. mp must
+// be zero'd before the call.
+bool cacheLoad(const char *dir, bool share, const unsigned char *bin, uint32_t len,
+               cacheMapping *mp);
+
+// Gives up the claim left in mp by a miss in
+// cacheLoad, when bin could not be decoded
+void cacheAbandon(cacheMapping *mp);
+
+// Stores the decoded memory of bin in the cache directory
+// dir (if it is not NULL) and shares it with later instances
+// in this process (if share is set), through an anonymous
+// file if the cache file cannot be written. mp is as left
+// by the cacheLoad which missed, and any claim in it is
+// completed or given up. Returns true and maps the stored
+// memory into mp if it could be shared. Failures are
+// otherwise ignored, since the cache is only an optimization.
+bool cacheStore(const char *dir, bool share, const unsigned char *bin, uint32_t len,
+                const uint32_t *memory, uint32_t memory_size, uint32_t entry,
+                cacheMapping *mp);
+
+// Discards writes to the given range of mapped memory
+// (in words), restoring it to the stored contents. The
+// range is rounded out to whole pages.
+void cacheRestore(cacheMapping *mp, uint32_t addr, uint32_t size);
+
+// Unmaps memory mapped by cacheLoad or cacheStore
+void cacheRelease(cacheMapping *mp);
+
+#endif
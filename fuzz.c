@@ -0,0 +1,205 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include "fuzz.h"
+
+// File descriptors of AFL's fork server pipes
+#define FORKSRV_FD 198
+
+// Environment variable holding AFL's shared bitmap id
+#define SHM_ENV_VAR "__AFL_SHM_ID"
+
+// Number of inputs a forked child runs before
+// exiting, so that leaks cannot accumulate
+#define PERSIST_RUNS 10000
+
+// Instructions an input file may run before it is
+// stopped. afl-fuzz applies its own timeout instead.
+#define RUN_LIMIT 10000000
+
+bool startForkServer(void);
+unsigned char *readAll(FILE *f, size_t *len);
+state fuzzAFL(fuzzTarget *t, unsigned char *coverage);
+state fuzzFiles(fuzzTarget *t, unsigned char *coverage, char **inputs, int ninputs);
+
+state fuzz(unsigned char *bin, uint32_t len, const options *opts,
+           char **inputs, int ninputs) {
+    state st;
+    fuzzTarget *t = newFuzzTarget(bin, len, opts, &st);
+    if (t == NULL)
+        return st;
+
+    unsigned char *coverage = NULL;
+    char *shmId = getenv(SHM_ENV_VAR);
+    if (shmId != NULL) {
+        coverage = (unsigned char*)shmat(atoi(shmId), NULL, 0);
+        if (coverage == (void*)-1) {
+            fprintf(stderr, "Could not attach AFL shared memory\n");
+            freeFuzzTarget(t);
+            return INTERN;
+        }
+    }
+
+    // The target is loaded before the fork
+    // server starts so every child inherits it
+    if (startForkServer())
+        st = fuzzAFL(t, coverage);
+    else
+        st = fuzzFiles(t, coverage, inputs, ninputs);
+
+    freeFuzzTarget(t);
+    return st;
+}
+
+// Runs AFL's fork server if afl-fuzz is listening.
+// Returns true in each forked child; the fork server
+// itself never returns. Returns false without AFL.
+bool startForkServer(void) {
+    uint32_t msg = 0;
+    if (write(FORKSRV_FD + 1, &msg, 4) != 4)
+        return false;
+
+    pid_t child = -1;
+    bool stopped = false;
+    while (1) {
+        uint32_t wasKilled;
+        int status;
+        if (read(FORKSRV_FD, &wasKilled, 4) != 4)
+            _exit(1);
+
+        // afl-fuzz killed a stopped child after a
+        // timeout; reap it and fork a new one
+        if (stopped && wasKilled) {
+            stopped = false;
+            if (waitpid(child, &status, 0) < 0)
+                _exit(1);
+        }
+
+        if (stopped) {
+            // Let a persistent child run the next input
+            kill(child, SIGCONT);
+            stopped = false;
+        } else {
+            child = fork();
+            if (child < 0)
+                _exit(1);
+            if (child == 0) {
+                close(FORKSRV_FD);
+                close(FORKSRV_FD + 1);
+                return true;
+            }
+        }
+
+        if (write(FORKSRV_FD + 1, &child, 4) != 4)
+            _exit(1);
+        if (waitpid(child, &status, WUNTRACED) < 0)
+            _exit(1);
+        if (WIFSTOPPED(status))
+            stopped = true;
+        if (write(FORKSRV_FD + 1, &status, 4) != 4)
+            _exit(1);
+    }
+}
+
+// Runs inputs from stdin in a forked child, stopping
+// after each one so the fork server can report it.
+// Failures abort so that afl-fuzz sees a crash.
+state fuzzAFL(fuzzTarget *t, unsigned char *coverage) {
+    for (int i = 0; i < PERSIST_RUNS; i++) {
+        if (i > 0)
+            raise(SIGSTOP);
+
+        size_t len;
+        unsigned char *input = readAll(stdin, &len);
+        if (input == NULL)
+            abort();
+        rewind(stdin);
+
+        state st = runFuzzTarget(t, input, len, coverage, 0);
+        free(input);
+        if (st != HALT)
+            abort();
+    }
+    return HALT;
+}
+
+// Runs each input file, then reports throughput
+state fuzzFiles(fuzzTarget *t, unsigned char *coverage, char **inputs, int ninputs) {
+    unsigned char *local = NULL;
+    if (coverage == NULL) {
+        local = (unsigned char*)calloc(COVERAGE_SIZE, 1);
+        if (local == NULL)
+            return MEM;
+        coverage = local;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    state result = HALT;
+    for (int i = 0; i < ninputs; i++) {
+        FILE *f = fopen(inputs[i], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Could not open file: %s\n", inputs[i]);
+            continue;
+        }
+        size_t len;
+        unsigned char *input = readAll(f, &len);
+        fclose(f);
+        if (input == NULL) {
+            free(local);
+            return MEM;
+        }
+
+        state st = runFuzzTarget(t, input, len, coverage, RUN_LIMIT);
+        free(input);
+        if (st == RUN)
+            fprintf(stderr, "%s: machine stopped after %d instructions\n", inputs[i], RUN_LIMIT);
+        else if (st != HALT)
+            fprintf(stderr, "%s: machine did not halt normally (state %d)\n", inputs[i], st);
+        if (st != HALT && result == HALT)
+            result = st;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    int edges = 0;
+    for (int i = 0; i < COVERAGE_SIZE; i++)
+        edges += coverage[i] != 0;
+    fprintf(stderr, "%d inputs in %.3fs (%.0f execs/s), %d edges covered\n",
+            ninputs, secs, secs > 0 ? ninputs / secs : 0.0, edges);
+
+    free(local);
+    return result;
+}
+
+// Reads the rest of f into a malloc'd buffer
+unsigned char *readAll(FILE *f, size_t *len) {
+    size_t cap = 4096;
+    unsigned char *buf = (unsigned char*)malloc(cap);
+    *len = 0;
+    while (buf != NULL) {
+        *len += fread(buf + *len, 1, cap - *len, f);
+        if (*len < cap)
+            break;
+        cap *= 2;
+        unsigned char *grown = (unsigned char*)realloc(buf, cap);
+        if (grown == NULL)
+            free(buf);
+        buf = grown;
+    }
+    return buf;
+}
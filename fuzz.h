@@ -0,0 +1,22 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef FUZZ_INC
+#define FUZZ_INC
+
+#include "machine.h"
+
+// Runs a binary in persistent fuzzing mode. The binary is
+// loaded once and run on each input in turn. If started by
+// afl-fuzz, inputs are read from stdin under AFL's fork
+// server and coverage is recorded in AFL's shared bitmap;
+// otherwise each of the ninputs files in inputs is run,
+// and a file which runs too many instructions is stopped.
+// Returns HALT if every input halted, and otherwise the
+// state of the first input which did not (RUN if it was
+// stopped).
+state fuzz(unsigned char *bin, uint32_t len, const options *opts,
+           char **inputs, int ninputs);
+
+#endif
@@ -2,12 +2,20 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "machine.h"
+#include "cache.h"
+#include "perf.h"
+#include "trace.h"
+#include "stats.h"
+#include "memsim.h"
 
 // Type of a machine word
 typedef uint32_t mword;
@@ -21,6 +29,18 @@ typedef union {
 
 #define MAX_MWORD 0xFFFFFFFF
 
+// Magic number and version which identify
+// a sectioned image ("MCHN")
+#define IMAGE_MAGIC   0x4D43484E
+#define IMAGE_VERSION 1
+
+// Segment kinds in a sectioned image
+enum {
+    SEG_DATA,   // Words stored verbatim
+    SEG_ZERO,   // Zero-filled, nothing stored
+    SEG_RLE     // Words stored as (count, value) runs
+};
+
 typedef struct {
     state state;
 
@@ -33,6 +53,9 @@ typedef struct {
     // Memory
     mword *memory;
     mword memory_size;
+    cacheMapping mapping;   // Where memory was mapped from, if
+                            //   it was not allocated by calloc
+    mword entry;            // Initial program counter
 
     // Protected mode
     bool protected;
@@ -43,12 +66,58 @@ typedef struct {
     mword vlow, vhigh;
     mword timer;
 
+    // Set if any of the instrumentation below is
+    // enabled, so that the plain interpreter only
+    // pays for a single check per instruction
+    bool hooks;
+
+    // Profiling
+    uint64_t retired;       // Instructions executed
+                            //   (only counted with hooks)
+    bool perfOps;           // Publish op codes for perf sampling
+    traceBuffer *trace;     // Recent execution history, or NULL
+    memSim *memsim;         // Simulated caches, or NULL
+
+    // Statistics
+    statsRegion *stats;     // Where statistics are published, or NULL
+    uint64_t modeSwitches;
+    uint64_t faults[STATS_FAULTS];
+    uint64_t outBytes, inBytes;
+
+    // Fuzzing
+    unsigned char *coverage;    // Edge coverage map, or NULL
+    mword prevLoc;              // Previous location, for coverage edges
+    unsigned char *dirty;       // One flag per page written since
+                                //   the last reset, or NULL
+    mword *dirtyPages;          // Indices of the flagged pages
+    mword dirtyCount;
+    unsigned int pageShift;     // log2 of the words in a page
+    const unsigned char *input; // I/O device input, or NULL for stdin
+    size_t inputLen, inputPos;
+    uint64_t limit;             // Value of retired at which to stop
+                                //   the run, or 0 for no limit
+
 } machine;
 
-void loadMachine(machine *m, unsigned char *bin, mword len);
+struct fuzzTarget {
+    machine m;
+    mword *pristine;    // Initial memory, if it was not mapped
+};
+
+void loadMachine(machine *m, unsigned char *bin, mword len, const options *opts);
+void loadLegacy(machine *m, unsigned char *bin, mword len);
+void loadSectioned(machine *m, unsigned char *bin, mword len);
+mword readWord(unsigned char *b);
 void runner(machine *m);
 void cleanup(machine *m);
 void fault(machine *m, mword fcode);
+void coverEdge(machine *m, mword loc);
+void markDirty(machine *m, mword addr);
+uint8_t traceFlags(machine *m);
+mword currentPc(machine *m);
+void publishStats(machine *m, bool waiting);
+void accessHook(machine *m, mword addr, int kind);
+void resetMachine(fuzzTarget *t);
 
 // Used to extract bit fields
 typedef union {
@@ -71,6 +140,8 @@ typedef union {
     } loadValueFields;
 } instruction;
 
+void executeHook(machine *m, mword ctr, instruction instr);
+
 // Type of functions which handle instructions
 typedef state(cmd)(machine *m, instruction instr);
 
@@ -140,32 +211,143 @@ enum {
     VM_FAULT,       // Accessed memory outside of set virtual memory
     VM_EXEC_FAULT,  // Executed an instruction outside of set virtual memory
     WORD_FAULT,     // Invalid instruction word
-    DIV_ZERO_FAULT  // Divided by zero
+    DIV_ZERO_FAULT, // Divided by zero
+    FAULT_CODES     // Number of fault codes
 };
 
+// Statistics count faults by code, so adding a fault code
+// must also grow STATS_FAULTS; this fails to compile if not
+typedef char faultCodesMatchStats[FAULT_CODES == STATS_FAULTS ? 1 : -1];
+
 state runMachine(unsigned char *bin, uint32_t len) {
+    options opts;
+    memset(&opts, 0, sizeof(opts));
+    return runMachineWithOptions(bin, len, &opts);
+}
+
+state runMachineWithOptions(unsigned char *bin, uint32_t len, const options *opts) {
     machine m;
-    loadMachine(&m, bin, len);
+    loadMachine(&m, bin, len, opts);
     if (m.state != RUN) {
         cleanup(&m);
         return m.state;
     }
-    runner(&m);
+    if (opts->tracePath != NULL) {
+        m.trace = traceOpen(opts->tracePath, opts->traceRecords != 0 ? opts->traceRecords : TRACE_RECORDS);
+        if (m.trace == NULL) {
+            cleanup(&m);
+            return MEM;
+        }
+    }
+    if (opts->stats) {
+        m.stats = statsOpen(opts->statsPath);
+        if (m.stats == NULL) {
+            if (m.trace != NULL)
+                traceClose(m.trace);
+            cleanup(&m);
+            return MEM;
+        }
+    }
+    if (opts->memsim != NULL) {
+        m.memsim = memSimOpen(opts->memsim, m.memory_size);
+        if (m.memsim == NULL) {
+            if (m.stats != NULL)
+                statsClose(m.stats);
+            if (m.trace != NULL)
+                traceClose(m.trace);
+            cleanup(&m);
+            return MEM;
+        }
+    }
+    m.hooks = m.trace != NULL || m.stats != NULL || m.memsim != NULL;
+    if (opts->perf && perfStart(opts->perfOpcodes)) {
+        // Counts are reported per instruction executed
+        m.hooks = true;
+        m.perfOps = opts->perfOpcodes;
+        runner(&m);
+        perfStop(m.retired);
+    } else {
+        runner(&m);
+    }
+    if (m.memsim != NULL) {
+        memSimReport(m.memsim);
+        memSimClose(m.memsim);
+    }
+    if (m.stats != NULL) {
+        publishStats(&m, false);
+        statsClose(m.stats);
+    }
+    if (m.trace != NULL) {
+        // Only abnormal exits leave a trace behind
+        traceAdd(m.trace, TRACE_END, traceFlags(&m), currentPc(&m), m.state, 0);
+        if (m.state != HALT)
+            traceDump(m.trace);
+        traceClose(m.trace);
+    }
     cleanup(&m);
     return m.state;
 }
 
-void loadMachine(machine *m, unsigned char *bin, mword len) {
-    
-    m->memory_size = bin[0];
-    m->memory_size <<= 8;
-    m->memory_size |= bin[1];
-    m->memory_size <<= 8;
-    m->memory_size |= bin[2];
-    m->memory_size <<= 8;
-    m->memory_size |= bin[3];
+void loadMachine(machine *m, unsigned char *bin, mword len, const options *opts) {
+    // Registers, lookaside registers and the
+    // rest of the protected mode state start
+    // zero'd, and execution begins in protected mode
+    memset(m, 0, sizeof(*m));
+    m->protected = true;
+
+    if (len < 4) {
+        m->state = FAIL;
+        return;
+    }
+
+    bool cached = opts->cacheDir != NULL || opts->share;
+
+    // A cache hit skips decoding entirely
+    if (cached && cacheLoad(opts->cacheDir, opts->share, bin, len, &m->mapping)) {
+        m->memory = m->mapping.memory;
+        m->memory_size = m->mapping.memory_size;
+        m->ctr = m->mapping.entry;
+        m->entry = m->ctr;
+        m->state = RUN;
+        return;
+    }
+
+    if (readWord(bin) == IMAGE_MAGIC)
+        loadSectioned(m, bin, len);
+    else
+        loadLegacy(m, bin, len);
+    m->entry = m->ctr;
+
+    // If the decoded memory is now shared, use the shared
+    // copy instead of our own. Either way, other instances
+    // waiting for this one to decode the binary go on.
+    if (m->state != RUN && cached)
+        cacheAbandon(&m->mapping);
+    else if (cached &&
+        cacheStore(opts->cacheDir, opts->share, bin, len, m->memory, m->memory_size, m->ctr, &m->mapping)) {
+        free(m->memory);
+        m->memory = m->mapping.memory;
+    }
+}
+
+// Reads a big-endian word
+mword readWord(unsigned char *b) {
+    mword word = b[0];
+    word <<= 8;
+    word |= b[1];
+    word <<= 8;
+    word |= b[2];
+    word <<= 8;
+    word |= b[3];
+    return word;
+}
+
+// Loads a binary which is a memory size
+// followed by every word of memory
+void loadLegacy(machine *m, unsigned char *bin, mword len) {
+    m->memory_size = readWord(bin);
     
-    if ((m->memory_size * 4) < (len - 4)) {
+    if (m->memory_size < (len - 4) / 4) {
         m->state = FAIL;
         return;
     }
@@ -178,40 +360,248 @@ void loadMachine(machine *m, unsigned char *bin, mword len) {
         return;
     }
     
+    // A trailing partial word is ignored
     unsigned char *b = bin + 4;
-    mword newWord;
-    for (int i = 0; b < bin + len; i++) {
-        newWord = *b;
-        b++;
-        newWord <<= 8;
-        newWord |= *b;
-        b++;
-        newWord <<= 8;
-        newWord |= *b;
-        b++;
-        newWord <<= 8;
-        newWord |= *b;
-        b++;
-        m->memory[i] = newWord;
+    for (int i = 0; b + 4 <= bin + len; i++) {
+        m->memory[i] = readWord(b);
+        b += 4;
     }
     
-    // Zero out registers
-    memset(m->reg, 0, sizeof(*(m->reg)) * 16);
     m->ctr = 0;
     m->state = RUN;
 }
 
+// Loads a sectioned image: a header of magic,
+// version, memory size, entry point and segment
+// count, followed by the segments. Each segment
+// is a kind, address, size and stored length
+// (all in words), followed by the stored words.
+void loadSectioned(machine *m, unsigned char *bin, mword len) {
+    if (len < 20 || readWord(bin + 4) != IMAGE_VERSION) {
+        m->state = FAIL;
+        return;
+    }
+
+    m->memory_size = readWord(bin + 8);
+    mword entry = readWord(bin + 12);
+    mword segments = readWord(bin + 16);
+
+    // Use calloc so memory is zero'd; zero-fill
+    // segments and zero runs are never written,
+    // so their pages are never touched
+    m->memory = (mword*)calloc(m->memory_size, sizeof(*(m->memory)));
+
+    if (m->memory == NULL) {
+        m->state = MEM;
+        return;
+    }
+
+    unsigned char *b = bin + 20;
+    unsigned char *end = bin + len;
+    for (mword s = 0; s < segments; s++) {
+        if (end - b < 16) {
+            m->state = FAIL;
+            return;
+        }
+
+        mword kind = readWord(b);
+        mword addr = readWord(b + 4);
+        mword size = readWord(b + 8);
+        mword stored = readWord(b + 12);
+        b += 16;
+
+        // Check both separately because
+        // addr + size could wrap around
+        if (addr > m->memory_size || size > m->memory_size - addr ||
+            stored > (end - b) / 4) {
+            m->state = FAIL;
+            return;
+        }
+
+        mword *dst = m->memory + addr;
+        switch (kind) {
+            case SEG_DATA:
+                if (stored != size) {
+                    m->state = FAIL;
+                    return;
+                }
+                for (mword i = 0; i < size; i++)
+                    dst[i] = readWord(b + 4 * i);
+                break;
+            case SEG_ZERO:
+                if (stored != 0) {
+                    m->state = FAIL;
+                    return;
+                }
+                break;
+            case SEG_RLE: {
+                if (stored % 2 != 0) {
+                    m->state = FAIL;
+                    return;
+                }
+                mword filled = 0;
+                for (mword i = 0; i < stored; i += 2) {
+                    mword count = readWord(b + 4 * i);
+                    mword value = readWord(b + 4 * i + 4);
+                    if (count > size - filled) {
+                        m->state = FAIL;
+                        return;
+                    }
+                    if (value != 0) {
+                        for (mword j = 0; j < count; j++)
+                            dst[filled + j] = value;
+                    }
+                    filled += count;
+                }
+                if (filled != size) {
+                    m->state = FAIL;
+                    return;
+                }
+                break;
+            }
+            default:
+                m->state = FAIL;
+                return;
+        }
+        b += stored * 4;
+    }
+
+    // Trailing bytes mean a malformed image
+    if (b != end) {
+        m->state = FAIL;
+        return;
+    }
+
+    m->ctr = entry;
+    m->state = RUN;
+}
+
 void cleanup(machine *m) {
-    if (m->memory != NULL)
+    free(m->dirty);
+    free(m->dirtyPages);
+    if (m->memory == NULL)
+        return;
+    if (m->mapping.memory != NULL)
+        cacheRelease(&m->mapping);
+    else
         free(m->memory);
 }
 
-void runner(machine *m) {
+fuzzTarget *newFuzzTarget(unsigned char *bin, uint32_t len, const options *opts, state *st) {
+    fuzzTarget *t = (fuzzTarget*)calloc(1, sizeof(*t));
+    if (t == NULL) {
+        *st = MEM;
+        return NULL;
+    }
+
+    // Share the image so that memory is mapped
+    // and resets can drop the written pages
+    options shared = *opts;
+    shared.share = true;
+
+    machine *m = &t->m;
+    loadMachine(m, bin, len, &shared);
+    if (m->state != RUN) {
+        *st = m->state;
+        cleanup(m);
+        free(t);
+        return NULL;
+    }
+
+    // Pages are the host's pages, so
+    // that mapped pages can be dropped
+    mword pageWords = (mword)sysconf(_SC_PAGESIZE) / sizeof(*(m->memory));
+    while (((mword)1 << (m->pageShift + 1)) <= pageWords)
+        m->pageShift++;
+    mword pages = (mword)(((uint64_t)m->memory_size + ((mword)1 << m->pageShift) - 1) >> m->pageShift);
+
+    m->hooks = true;
+    m->dirty = (unsigned char*)calloc(pages + 1, sizeof(*(m->dirty)));
+    m->dirtyPages = (mword*)calloc(pages + 1, sizeof(*(m->dirtyPages)));
+    if (m->mapping.memory == NULL && m->memory_size != 0) {
+        t->pristine = (mword*)malloc(m->memory_size * sizeof(*(m->memory)));
+        if (t->pristine != NULL)
+            memcpy(t->pristine, m->memory, m->memory_size * sizeof(*(m->memory)));
+    }
+    if (m->dirty == NULL || m->dirtyPages == NULL ||
+        (m->mapping.memory == NULL && m->memory_size != 0 && t->pristine == NULL)) {
+        *st = MEM;
+        freeFuzzTarget(t);
+        return NULL;
+    }
+
+    *st = RUN;
+    return t;
+}
+
+state runFuzzTarget(fuzzTarget *t, const unsigned char *input, size_t inputLen,
+                    unsigned char *coverage, uint64_t limit) {
+    machine *m = &t->m;
+    resetMachine(t);
+    m->coverage = coverage;
+    m->input = input;
+    m->inputLen = inputLen;
+    m->limit = limit != 0 ? m->retired + limit : 0;
+    runner(m);
+    return m->state;
+}
+
+void freeFuzzTarget(fuzzTarget *t) {
+    cleanup(&t->m);
+    free(t->pristine);
+    free(t);
+}
+
+// Restores a fuzz target to its state after loading
+void resetMachine(fuzzTarget *t) {
+    machine *m = &t->m;
+    for (mword i = 0; i < m->dirtyCount; i++) {
+        mword page = m->dirtyPages[i];
+        mword addr = page << m->pageShift;
+        mword size = (mword)1 << m->pageShift;
+        if (size > m->memory_size - addr)
+            size = m->memory_size - addr;
+
+        if (t->pristine != NULL)
+            memcpy(m->memory + addr, t->pristine + addr, size * sizeof(*(m->memory)));
+        else
+            cacheRestore(&m->mapping, addr, size);
+        m->dirty[page] = 0;
+    }
+    m->dirtyCount = 0;
+
+    memset(m->reg, 0, sizeof(*(m->reg)) * 16);
+    memset(m->lreg, 0, sizeof(*(m->lreg)) * 16);
+    m->ctr = m->entry;
+    m->protected = true;
+    m->callback = 0;
+    m->fault = 0;
+    m->lctr = 0;
+    m->vlow = 0;
+    m->vhigh = 0;
+    m->timer = 0;
+    m->prevLoc = 0;
+    m->inputPos = 0;
+    m->state = RUN;
+}
+
+// The interpreter loop. It is inlined into runner
+// twice, so that the copy without hooks never tests
+// for instrumentation.
+static inline void runLoop(machine *m, const bool hooks) {
     while (1) {
+        // Stop a run which is out of instructions,
+        // leaving the machine running
+        if (hooks && m->retired == m->limit && m->limit != 0)
+            return;
+
         mword ctr;
         if (m->protected) {
             ctr = m->ctr;
             if (ctr >= m->memory_size) {
+                // Increment as if the word had been fetched,
+                // so that currentPc reports the failing address
+                m->ctr++;
                 m->state = FAIL;
                 return;
             }
@@ -240,16 +630,36 @@ void runner(machine *m) {
                 continue;
             }
         }
+        if (hooks)
+            executeHook(m, ctr, instr);
         m->state = runCmd(m, instr);
         if (m->state != RUN)
             return;
+
+        // Both the taken and the fallthrough
+        // edge of a conditional jump are recorded
+        if (hooks && m->coverage != NULL && instr.fields.op == CJMP)
+            coverEdge(m, m->protected ? m->ctr : m->vlow + m->ctr);
     }
     
     // Should return from inside while loop
     m->state = INTERN;
 }
 
+void runner(machine *m) {
+    if (m->hooks)
+        runLoop(m, true);
+    else
+        runLoop(m, false);
+}
+
 void fault(machine *m, mword fcode) {
+    if (m->trace != NULL)
+        traceAdd(m->trace, TRACE_FAULT, TRACE_USER, currentPc(m), fcode, m->callback);
+    m->modeSwitches++;
+    if (fcode < FAULT_CODES)
+        m->faults[fcode]++;
+
     // Since the runner decrements timer every time,
     // but timer is logically not decremented in the
     // event of a fault, correct that.
@@ -265,6 +675,81 @@ void fault(machine *m, mword fcode) {
     m->fault = fcode;
     m->protected = true;
     m->ctr = m->callback;
+
+    // Mix in the fault code so that different faults
+    // at the same instruction are different edges
+    if (m->coverage != NULL)
+        coverEdge(m, (m->vlow + m->lctr) ^ (fcode << 24) ^ 0x80000000);
+}
+
+// Counts the edge from the previous location to loc
+// in the coverage map, as AFL's instrumentation does
+void coverEdge(machine *m, mword loc) {
+    mword cur = (loc * 0x9E3779B1) >> 16;
+    m->coverage[(cur ^ m->prevLoc) & (COVERAGE_SIZE - 1)]++;
+    m->prevLoc = cur >> 1;
+}
+
+// Publishes the machine's counters, with the
+// instruction being executed as the program counter
+void publishStats(machine *m, bool waiting) {
+    machineStats s;
+    memset(&s, 0, sizeof(s));
+    s.retired = m->retired;
+    s.modeSwitches = m->modeSwitches;
+    memcpy(s.faults, m->faults, sizeof(s.faults));
+    s.outBytes = m->outBytes;
+    s.inBytes = m->inBytes;
+    s.pc = currentPc(m);
+    s.timer = m->timer;
+    s.waiting = waiting;
+    statsPublish(m->stats, &s);
+}
+
+// Instrumentation run before each instruction
+// at physical address ctr is executed
+void executeHook(machine *m, mword ctr, instruction instr) {
+    m->retired++;
+    if (m->trace != NULL)
+        traceAdd(m->trace, TRACE_EXEC, traceFlags(m), ctr, instr.word, m->timer);
+    if (m->stats != NULL && (m->retired & (STATS_INTERVAL - 1)) == 0)
+        publishStats(m, false);
+    if (m->memsim != NULL)
+        memSimAccess(m->memsim, ctr, ctr, MEMSIM_FETCH);
+    if (m->perfOps)
+        perfOp = instr.fields.op;
+}
+
+// Instrumentation run before the current instruction
+// accesses physical address addr; kind is a MEMSIM kind
+void accessHook(machine *m, mword addr, int kind) {
+    if (m->trace != NULL)
+        traceAdd(m->trace, TRACE_MEM, traceFlags(m), currentPc(m), addr, m->protected ? addr : addr - m->vlow);
+    if (m->dirty != NULL && kind == MEMSIM_STORE)
+        markDirty(m, addr);
+    if (m->memsim != NULL)
+        memSimAccess(m->memsim, currentPc(m), addr, kind);
+}
+
+// Physical address of the instruction being
+// executed, since the counter is incremented first
+mword currentPc(machine *m) {
+    return m->protected ? m->ctr - 1 : m->vlow + m->ctr - 1;
+}
+
+// Trace flags describing the machine's mode
+uint8_t traceFlags(machine *m) {
+    return m->protected ? 0 : TRACE_USER;
+}
+
+// Flags the page containing addr as written
+// so that it is restored on the next reset
+void markDirty(machine *m, mword addr) {
+    mword page = addr >> m->pageShift;
+    if (!m->dirty[page]) {
+        m->dirty[page] = 1;
+        m->dirtyPages[m->dirtyCount++] = page;
+    }
 }
 
 state runCmd(machine *m, instruction instr) {
@@ -433,6 +918,8 @@ state load(machine *m, instruction instr) {
         return mr.state;
     }
 
+    if (m->hooks)
+        accessHook(m, mr.addr, MEMSIM_LOAD);
     m->reg[instr.fields.a] = m->memory[mr.addr];
     return RUN;
 }
@@ -444,6 +931,8 @@ state store(machine *m, instruction instr) {
         return mr.state;
     }
 
+    if (m->hooks)
+        accessHook(m, mr.addr, MEMSIM_STORE);
     m->memory[mr.addr] = m->reg[instr.fields.b];
     return RUN;
 }
@@ -564,6 +1053,8 @@ state cas(machine *m, instruction instr) {
     if (!mr.cont) {
         return mr.state;
     }
+    if (m->hooks)
+        accessHook(m, mr.addr, MEMSIM_STORE);
     if (m->memory[mr.addr] == m->reg[instr.fields.b]) {
         m->memory[mr.addr] = m->reg[instr.fields.c];
         m->reg[instr.fields.b] = 1;
@@ -579,6 +1070,8 @@ state aadd(machine *m, instruction instr) {
     if (!mr.cont) {
         return mr.state;
     }
+    if (m->hooks)
+        accessHook(m, mr.addr, MEMSIM_STORE);
     m->memory[mr.addr] += m->reg[instr.fields.b];
     return RUN;
 }
@@ -602,7 +1095,10 @@ state out(machine *m, instruction instr) {
 
     if (m->reg[instr.fields.a] > 255)
         return FAIL;
-    fprintf(stdout, "%c", m->reg[instr.fields.a]);
+    // Output is discarded when input is not from stdin
+    if (m->input == NULL)
+        fprintf(stdout, "%c", m->reg[instr.fields.a]);
+    m->outBytes++;
     return RUN;
 }
 
@@ -613,11 +1109,25 @@ state in(machine *m, instruction instr) {
         return RUN;
     }
 
-    int c = getc(stdin);
-    if (c == EOF)
-        m->reg[instr.fields.a] = MAX_MWORD;
+    int c;
+    if (m->input == NULL) {
+        // Make it visible that the guest is
+        // waiting rather than stalled
+        if (m->stats != NULL)
+            publishStats(m, true);
+        c = getc(stdin);
+        if (m->stats != NULL)
+            publishStats(m, false);
+    } else if (m->inputPos < m->inputLen)
+        c = m->input[m->inputPos++];
     else
+        c = EOF;
+    if (c == EOF) {
+        m->reg[instr.fields.a] = MAX_MWORD;
+    } else {
         m->reg[instr.fields.a] = c;
+        m->inBytes++;
+    }
     return RUN;
 }
 
@@ -635,6 +1145,10 @@ state umode(machine *m, instruction instr) {
     }
     m->ctr = m->reg[instr.fields.a];
     memcpy(m->reg, m->lreg, sizeof(*(m->reg)) * 16);
+    m->protected = false;
+    if (m->trace != NULL)
+        traceAdd(m->trace, TRACE_UMODE, traceFlags(m), m->ctr, m->vlow, m->vhigh);
+    m->modeSwitches++;
     return RUN;
 }
 
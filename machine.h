@@ -6,6 +6,8 @@
 #define MACHINE_INC
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "memsim.h"
 
 typedef enum {
     RUN,        // State of a running machine
@@ -17,9 +19,57 @@ typedef enum {
                 //   (ie, a problem with this library)
 } state;
 
+// Options which control how a binary is run.
+// A zero'd options struct gives the default behavior.
+typedef struct {
+    const char *cacheDir;   // Directory of decoded images, or NULL
+    bool share;             // Share unwritten memory with other
+                            //   instances of the same binary
+    bool perf;              // Report host performance counters
+    bool perfOpcodes;       // Also attribute them to guest op codes
+    const char *tracePath;  // Where to dump the execution trace
+                            //   on abnormal exit, or NULL
+    uint32_t traceRecords;  // Records kept in the trace, or 0
+                            //   for the default
+    bool stats;             // Publish live statistics
+    const char *statsPath;  // File to publish them to, or NULL
+                            //   to only dump them on SIGUSR1
+    const memSimConfig *memsim; // Caches to simulate, or NULL
+} options;
+
 // Returns the state of the machine after execution has halted
 // It is a bug for runMachine to return RUN, as runMachine should
 // never return while the program is still running.
 state runMachine(unsigned char *bin, uint32_t len);
 
+// Same as runMachine, but with the given options
+state runMachineWithOptions(unsigned char *bin, uint32_t len, const options *opts);
+
+// Size in bytes of an edge coverage map. This
+// is the same as AFL's shared memory bitmap.
+#define COVERAGE_SIZE 65536
+
+// A binary which is loaded once and then run on many
+// inputs, as when fuzzing. Only the pages of memory
+// written by a run are restored before the next run.
+typedef struct fuzzTarget fuzzTarget;
+
+// Loads a binary for repeated runs. If it could not
+// be loaded, returns NULL and sets st to the state
+// of the machine.
+fuzzTarget *newFuzzTarget(unsigned char *bin, uint32_t len, const options *opts, state *st);
+
+// Runs a target from its initial state, reading I/O
+// device input from input rather than stdin and
+// discarding output. If coverage is not NULL, edges
+// taken by conditional jumps and faults are counted
+// in it (COVERAGE_SIZE bytes), in the manner of AFL.
+// If limit is not 0, a run which executes limit
+// instructions without stopping is stopped there,
+// and RUN is returned.
+state runFuzzTarget(fuzzTarget *t, const unsigned char *input, size_t inputLen,
+                    unsigned char *coverage, uint64_t limit);
+
+void freeFuzzTarget(fuzzTarget *t);
+
 #endif
\ No newline at end of file
@@ -2,9 +2,14 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "machine.h"
+#include "fuzz.h"
 
 // Exit codes
 #define NORMAL   0
@@ -13,17 +18,76 @@
 #define FAILURE  3
 #define MEMORY   4
 #define INTERNAL 5
+#define TIMEOUT  6
+
+void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c cachedir] [-p|-P] [-t trace [-T records]] [-s statsfile|-S] [-m caches] <binary>\n", name);
+    fprintf(stderr, "       %s -f [-c cachedir] <binary> [input...]\n", name);
+}
 
-int main (int argc, const char * argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <binary>\n", argv[0]);
+int main (int argc, char * argv[]) {
+    options opts;
+    memset(&opts, 0, sizeof(opts));
+    bool fuzzing = false;
+    bool running = false;   // Saw an option only a plain run takes
+    memSimConfig memsim;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "c:fpPt:T:s:Sm:")) != -1) {
+        switch (opt) {
+            case 'c':
+                opts.cacheDir = optarg;
+                break;
+            case 'f':
+                fuzzing = true;
+                break;
+            case 'P':
+                opts.perfOpcodes = true;
+                // fall through
+            case 'p':
+                opts.perf = true;
+                running = true;
+                break;
+            case 't':
+                opts.tracePath = optarg;
+                running = true;
+                break;
+            case 'T':
+                opts.traceRecords = (uint32_t)strtoul(optarg, NULL, 0);
+                running = true;
+                break;
+            case 's':
+                opts.statsPath = optarg;
+                // fall through
+            case 'S':
+                opts.stats = true;
+                running = true;
+                break;
+            case 'm':
+                if (!memSimParse(optarg, &memsim)) {
+                    fprintf(stderr, "Invalid caches: %s\n", optarg);
+                    return USAGE;
+                }
+                opts.memsim = &memsim;
+                running = true;
+                break;
+            default:
+                usage(argv[0]);
+                return USAGE;
+        }
+    }
+    
+    // Only fuzzing takes input files after the binary,
+    // and it takes none of the other options but -c
+    if (argc - optind < 1 || (!fuzzing && argc - optind != 1) || (fuzzing && running)) {
+        usage(argv[0]);
         return USAGE;
     }
     
-    FILE *f = fopen(argv[1], "rb");
+    FILE *f = fopen(argv[optind], "rb");
     
     if (f == NULL) {
-        fprintf(stderr, "Could not open file: %s\n", argv[1]);
+        fprintf(stderr, "Could not open file: %s\n", argv[optind]);
         return FILEIO;
     }
     
@@ -39,7 +103,11 @@ int main (int argc, const char * argv[]) {
     fread(bin, 1, len, f);
     fclose(f);
     
-    state st = runMachine(bin, (uint32_t)len);
+    state st;
+    if (fuzzing)
+        st = fuzz(bin, (uint32_t)len, &opts, argv + optind + 1, argc - optind - 1);
+    else
+        st = runMachineWithOptions(bin, (uint32_t)len, &opts);
     
     free(bin);
     
@@ -65,8 +133,15 @@ int main (int argc, const char * argv[]) {
             #endif
             return INTERNAL;
         
-        // Prevent compiler warning
+        // Only returned by fuzz, for an
+        // input which was stopped
         case RUN:
+            if (fuzzing) {
+                #ifdef DEBUG
+                    fprintf(stderr, "\n---\nProgram ran too long and has been stopped.\n");
+                #endif
+                return TIMEOUT;
+            }
             break;
     }
     #ifdef DEBUG
@@ -0,0 +1,452 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memsim.h"
+
+// Words in a page of the working set tracker
+#define PAGE_SHIFT 10
+
+// Accesses in a working set window
+#define WINDOW 1048576
+
+// Entries in each report table
+#define TOP 10
+
+// Pages reported for each of those instructions
+#define HOT_PAGES 3
+
+// A set-associative cache level with LRU replacement
+typedef struct {
+    uint32_t sets;
+    uint32_t ways;
+    unsigned int lineShift;
+    uint64_t *tags;     // sets * ways tags; tag + 1, or 0 if empty
+    uint64_t *stamps;   // Time of each way's last use
+    uint64_t accesses;
+    uint64_t misses;
+} level;
+
+// Accesses by the instruction at one pc
+typedef struct {
+    uint32_t pc;
+    bool used;
+    uint64_t accesses;
+    uint64_t misses[MEMSIM_LEVELS];
+} pcEntry;
+
+// First level misses by the instruction at one pc in one page
+typedef struct {
+    uint32_t pc;
+    uint32_t page;
+    uint64_t misses;    // 0 if the slot is empty
+} pcPage;
+
+struct memSim {
+    memSimConfig cfg;
+    level levels[MEMSIM_LEVELS];
+    uint64_t clock;     // Accesses so far
+    uint64_t kinds[MEMSIM_KINDS];
+
+    // Reuse distances, in accesses, of first level lines,
+    // as a histogram of floor(log2(distance))
+    uint64_t *lastUse;  // Time of each line's last access + 1, or 0
+    unsigned int reuseShift;
+    uint64_t reuse[64];
+    uint64_t cold;
+
+    // Working set
+    uint32_t pages;
+    uint64_t *pageAccesses;
+    uint64_t *pageMisses;   // First level misses
+    uint64_t *pageWindow;   // Window of each page's last access + 1
+    uint64_t windowPages;   // Pages touched in the current window
+    uint64_t windows;
+    uint64_t windowTotal;
+    uint64_t windowMax;
+    uint64_t touched;       // Pages ever touched
+
+    // Open-addressed table of pcs
+    pcEntry *pcs;
+    uint32_t pcCap;
+    uint32_t pcCount;
+
+    // Open-addressed table of (pc, page) pairs
+    pcPage *pcPages;
+    uint64_t pcPageCap;
+    uint64_t pcPageCount;
+};
+
+bool parseSize(const char **p, uint64_t *n);
+bool levelAccess(level *l, uint64_t byte, uint64_t clock);
+pcEntry *findPc(memSim *s, uint32_t pc);
+pcPage *findPcPage(memSim *s, uint32_t pc, uint32_t page);
+uint64_t pcPageSlot(uint32_t pc, uint32_t page, uint64_t cap);
+void closeWindow(memSim *s);
+int log2floor(uint64_t n);
+void reportPcPages(memSim *s, uint32_t pc);
+
+// Parses a number with an optional K or M suffix
+bool parseSize(const char **p, uint64_t *n) {
+    char *end;
+    unsigned long long v = strtoull(*p, &end, 10);
+    if (end == *p)
+        return false;
+    if (*end == 'K' || *end == 'k') {
+        v <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        v <<= 20;
+        end++;
+    }
+    *n = v;
+    *p = end;
+    return true;
+}
+
+bool memSimParse(const char *spec, memSimConfig *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    const char *p = spec;
+    while (1) {
+        if (cfg->levels == MEMSIM_LEVELS)
+            return false;
+
+        uint64_t size, ways, line;
+        if (!parseSize(&p, &size) || *p++ != ':' ||
+            !parseSize(&p, &ways) || *p++ != ':' ||
+            !parseSize(&p, &line))
+            return false;
+
+        if (line < 4 || (line & (line - 1)) != 0 || line > UINT32_MAX ||
+            ways == 0 || ways > UINT32_MAX || size % (ways * line) != 0)
+            return false;
+        uint64_t sets = size / (ways * line);
+        if (sets == 0 || (sets & (sets - 1)) != 0 || sets > UINT32_MAX)
+            return false;
+
+        cfg->level[cfg->levels].size = size;
+        cfg->level[cfg->levels].ways = (uint32_t)ways;
+        cfg->level[cfg->levels].line = (uint32_t)line;
+        cfg->levels++;
+
+        if (*p == '\0')
+            return true;
+        if (*p++ != ',')
+            return false;
+    }
+}
+
+memSim *memSimOpen(const memSimConfig *cfg, uint32_t memory_size) {
+    memSim *s = (memSim*)calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+    s->cfg = *cfg;
+
+    bool ok = true;
+    for (int i = 0; i < cfg->levels; i++) {
+        level *l = &s->levels[i];
+        l->ways = cfg->level[i].ways;
+        l->sets = (uint32_t)(cfg->level[i].size / ((uint64_t)l->ways * cfg->level[i].line));
+        while (((uint32_t)1 << l->lineShift) < cfg->level[i].line)
+            l->lineShift++;
+        l->tags = (uint64_t*)calloc((size_t)l->sets * l->ways, sizeof(*(l->tags)));
+        l->stamps = (uint64_t*)calloc((size_t)l->sets * l->ways, sizeof(*(l->stamps)));
+        ok = ok && l->tags != NULL && l->stamps != NULL;
+    }
+
+    // Only the lines and pages which are
+    // touched are ever faulted in by calloc
+    s->reuseShift = s->levels[0].lineShift;
+    uint64_t lines = (((uint64_t)memory_size << 2) >> s->reuseShift) + 1;
+    s->lastUse = (uint64_t*)calloc(lines, sizeof(*(s->lastUse)));
+
+    s->pages = (uint32_t)(((uint64_t)memory_size + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT);
+    s->pageAccesses = (uint64_t*)calloc(s->pages + 1, sizeof(*(s->pageAccesses)));
+    s->pageMisses = (uint64_t*)calloc(s->pages + 1, sizeof(*(s->pageMisses)));
+    s->pageWindow = (uint64_t*)calloc(s->pages + 1, sizeof(*(s->pageWindow)));
+
+    s->pcCap = 1024;
+    s->pcs = (pcEntry*)calloc(s->pcCap, sizeof(*(s->pcs)));
+    s->pcPageCap = 1024;
+    s->pcPages = (pcPage*)calloc(s->pcPageCap, sizeof(*(s->pcPages)));
+
+    if (!ok || s->lastUse == NULL || s->pageAccesses == NULL || s->pageMisses == NULL ||
+        s->pageWindow == NULL || s->pcs == NULL || s->pcPages == NULL) {
+        memSimClose(s);
+        return NULL;
+    }
+    return s;
+}
+
+// Looks up a byte address in a level, filling its line
+// on a miss. Returns true on a hit.
+bool levelAccess(level *l, uint64_t byte, uint64_t clock) {
+    uint64_t line = byte >> l->lineShift;
+    uint64_t *tags = l->tags + (size_t)(line & (l->sets - 1)) * l->ways;
+    uint64_t *stamps = l->stamps + (tags - l->tags);
+    uint64_t tag = line + 1;
+
+    l->accesses++;
+    uint32_t victim = 0;
+    for (uint32_t w = 0; w < l->ways; w++) {
+        if (tags[w] == tag) {
+            stamps[w] = clock;
+            return true;
+        }
+        // Empty ways have the oldest stamp, 0
+        if (stamps[w] < stamps[victim])
+            victim = w;
+    }
+    l->misses++;
+    tags[victim] = tag;
+    stamps[victim] = clock;
+    return false;
+}
+
+// Returns the entry for pc, adding it if it is new
+pcEntry *findPc(memSim *s, uint32_t pc) {
+    if (s->pcCount * 2 >= s->pcCap) {
+        pcEntry *grown = (pcEntry*)calloc((size_t)s->pcCap * 2, sizeof(*grown));
+        if (grown != NULL) {
+            for (uint32_t i = 0; i < s->pcCap; i++) {
+                if (!s->pcs[i].used)
+                    continue;
+                uint32_t j = (s->pcs[i].pc * 0x9E3779B1) & (s->pcCap * 2 - 1);
+                while (grown[j].used)
+                    j = (j + 1) & (s->pcCap * 2 - 1);
+                grown[j] = s->pcs[i];
+            }
+            free(s->pcs);
+            s->pcs = grown;
+            s->pcCap *= 2;
+        }
+    }
+
+    uint32_t i = (pc * 0x9E3779B1) & (s->pcCap - 1);
+    while (s->pcs[i].used && s->pcs[i].pc != pc)
+        i = (i + 1) & (s->pcCap - 1);
+    if (!s->pcs[i].used) {
+        s->pcs[i].used = true;
+        s->pcs[i].pc = pc;
+        s->pcCount++;
+    }
+    return &s->pcs[i];
+}
+
+uint64_t pcPageSlot(uint32_t pc, uint32_t page, uint64_t cap) {
+    return ((((uint64_t)pc << 32) | page) * 0x9E3779B97F4A7C15ULL >> 32) & (cap - 1);
+}
+
+// Returns the entry for (pc, page), adding it if it is new,
+// or NULL if it is new and the table is full and cannot grow
+pcPage *findPcPage(memSim *s, uint32_t pc, uint32_t page) {
+    if (s->pcPageCount * 2 >= s->pcPageCap) {
+        pcPage *grown = (pcPage*)calloc((size_t)s->pcPageCap * 2, sizeof(*grown));
+        if (grown != NULL) {
+            for (uint64_t i = 0; i < s->pcPageCap; i++) {
+                if (s->pcPages[i].misses == 0)
+                    continue;
+                uint64_t j = pcPageSlot(s->pcPages[i].pc, s->pcPages[i].page, s->pcPageCap * 2);
+                while (grown[j].misses != 0)
+                    j = (j + 1) & (s->pcPageCap * 2 - 1);
+                grown[j] = s->pcPages[i];
+            }
+            free(s->pcPages);
+            s->pcPages = grown;
+            s->pcPageCap *= 2;
+        }
+    }
+
+    uint64_t i = pcPageSlot(pc, page, s->pcPageCap);
+    while (s->pcPages[i].misses != 0 && (s->pcPages[i].pc != pc || s->pcPages[i].page != page))
+        i = (i + 1) & (s->pcPageCap - 1);
+    if (s->pcPages[i].misses == 0) {
+        if (s->pcPageCount + 1 >= s->pcPageCap)
+            return NULL;
+        s->pcPages[i].pc = pc;
+        s->pcPages[i].page = page;
+        s->pcPageCount++;
+    }
+    return &s->pcPages[i];
+}
+
+int log2floor(uint64_t n) {
+    int i = 0;
+    while (n >>= 1)
+        i++;
+    return i;
+}
+
+void closeWindow(memSim *s) {
+    s->windows++;
+    s->windowTotal += s->windowPages;
+    if (s->windowPages > s->windowMax)
+        s->windowMax = s->windowPages;
+    s->windowPages = 0;
+}
+
+void memSimAccess(memSim *s, uint32_t pc, uint32_t addr, int kind) {
+    uint64_t byte = (uint64_t)addr << 2;
+    s->clock++;
+    s->kinds[kind]++;
+
+    uint64_t *last = &s->lastUse[byte >> s->reuseShift];
+    if (*last == 0)
+        s->cold++;
+    else
+        s->reuse[log2floor(s->clock - *last)]++;
+    *last = s->clock;
+
+    // Go out to farther levels until one hits; each
+    // level which missed is filled on the way back
+    pcEntry *e = findPc(s, pc);
+    e->accesses++;
+    int missed = 0;
+    while (missed < s->cfg.levels && !levelAccess(&s->levels[missed], byte, s->clock)) {
+        e->misses[missed]++;
+        missed++;
+    }
+
+    uint32_t page = addr >> PAGE_SHIFT;
+    s->pageAccesses[page]++;
+    if (missed > 0) {
+        s->pageMisses[page]++;
+        pcPage *pp = findPcPage(s, pc, page);
+        if (pp != NULL)
+            pp->misses++;
+    }
+
+    uint64_t window = s->clock / WINDOW + 1;
+    if (s->pageWindow[page] != window) {
+        if (s->pageWindow[page] == 0)
+            s->touched++;
+        s->pageWindow[page] = window;
+        s->windowPages++;
+    }
+    if (s->clock % WINDOW == 0)
+        closeWindow(s);
+}
+
+// Prints the pages the instruction at pc
+// misses in most, with its misses in each
+void reportPcPages(memSim *s, uint32_t pc) {
+    uint64_t bound = UINT64_MAX;
+    uint32_t boundPage = 0;
+    for (int n = 0; n < HOT_PAGES; n++) {
+        pcPage *best = NULL;
+        for (uint64_t i = 0; i < s->pcPageCap; i++) {
+            pcPage *e = &s->pcPages[i];
+            if (e->misses == 0 || e->pc != pc || e->misses > bound ||
+                (e->misses == bound && e->page <= boundPage))
+                continue;
+            if (best == NULL || e->misses > best->misses ||
+                (e->misses == best->misses && e->page < best->page))
+                best = e;
+        }
+        if (best == NULL)
+            break;
+        fprintf(stderr, "%10s %12s %12llu   page %x-%x\n", "", "", (unsigned long long)best->misses,
+                best->page << PAGE_SHIFT, ((best->page + 1) << PAGE_SHIFT) - 1);
+        bound = best->misses;
+        boundPage = best->page;
+    }
+}
+
+void memSimReport(memSim *s) {
+    if (s->windowPages != 0)
+        closeWindow(s);
+
+    fprintf(stderr, "\n---\nMemory accesses: %llu (%llu fetches, %llu loads, %llu stores)\n",
+            (unsigned long long)s->clock, (unsigned long long)s->kinds[MEMSIM_FETCH],
+            (unsigned long long)s->kinds[MEMSIM_LOAD], (unsigned long long)s->kinds[MEMSIM_STORE]);
+
+    for (int i = 0; i < s->cfg.levels; i++) {
+        level *l = &s->levels[i];
+        fprintf(stderr, "Level %d (%llu bytes, %u ways, %u byte lines): %llu accesses, %llu misses (%.2f%%)\n",
+                i + 1, (unsigned long long)s->cfg.level[i].size, l->ways, s->cfg.level[i].line,
+                (unsigned long long)l->accesses, (unsigned long long)l->misses,
+                l->accesses != 0 ? 100.0 * l->misses / l->accesses : 0.0);
+    }
+
+    fprintf(stderr, "\nReuse distance of level 1 lines, in accesses:\n");
+    fprintf(stderr, "%24s %llu\n", "first use", (unsigned long long)s->cold);
+    for (int i = 0; i < 64; i++) {
+        if (s->reuse[i] == 0)
+            continue;
+        char range[48];
+        snprintf(range, sizeof(range), "[%llu, %llu)", 1ULL << i, 1ULL << (i + 1));
+        fprintf(stderr, "%24s %llu\n", range, (unsigned long long)s->reuse[i]);
+    }
+
+    fprintf(stderr, "\nWorking set: %llu pages of %d words touched; %.1f on average and %llu at most per %d accesses\n",
+            (unsigned long long)s->touched, 1 << PAGE_SHIFT,
+            s->windows != 0 ? (double)s->windowTotal / s->windows : 0.0,
+            (unsigned long long)s->windowMax, WINDOW);
+
+    // Repeatedly pick the largest entry not yet reported;
+    // fine for the small number of entries reported
+    fprintf(stderr, "\nHottest pages:\n%10s %10s %12s %12s\n", "first word", "last word", "accesses", "L1 misses");
+    uint64_t bound = UINT64_MAX;
+    uint32_t boundPage = 0;
+    for (int n = 0; n < TOP; n++) {
+        uint32_t best = s->pages;
+        for (uint32_t p = 0; p < s->pages; p++) {
+            uint64_t a = s->pageAccesses[p];
+            if (a == 0 || a > bound || (a == bound && p <= boundPage))
+                continue;
+            if (best == s->pages || a > s->pageAccesses[best])
+                best = p;
+        }
+        if (best == s->pages)
+            break;
+        fprintf(stderr, "%10x %10x %12llu %12llu\n", best << PAGE_SHIFT,
+                ((best + 1) << PAGE_SHIFT) - 1, (unsigned long long)s->pageAccesses[best],
+                (unsigned long long)s->pageMisses[best]);
+        bound = s->pageAccesses[best];
+        boundPage = best;
+    }
+
+    fprintf(stderr, "\nInstructions with the most level 1 misses, and the pages they miss in most:\n"
+            "%10s %12s %12s %8s\n", "pc", "accesses", "L1 misses", "rate");
+    bound = UINT64_MAX;
+    uint32_t boundPc = 0;
+    for (int n = 0; n < TOP; n++) {
+        pcEntry *best = NULL;
+        for (uint32_t i = 0; i < s->pcCap; i++) {
+            pcEntry *e = &s->pcs[i];
+            if (!e->used || e->misses[0] == 0 || e->misses[0] > bound ||
+                (e->misses[0] == bound && e->pc <= boundPc))
+                continue;
+            if (best == NULL || e->misses[0] > best->misses[0] ||
+                (e->misses[0] == best->misses[0] && e->pc < best->pc))
+                best = e;
+        }
+        if (best == NULL)
+            break;
+        fprintf(stderr, "%10x %12llu %12llu %7.2f%%\n", best->pc,
+                (unsigned long long)best->accesses, (unsigned long long)best->misses[0],
+                100.0 * best->misses[0] / best->accesses);
+        reportPcPages(s, best->pc);
+        bound = best->misses[0];
+        boundPc = best->pc;
+    }
+}
+
+void memSimClose(memSim *s) {
+    for (int i = 0; i < MEMSIM_LEVELS; i++) {
+        free(s->levels[i].tags);
+        free(s->levels[i].stamps);
+    }
+    free(s->lastUse);
+    free(s->pageAccesses);
+    free(s->pageMisses);
+    free(s->pageWindow);
+    free(s->pcs);
+    free(s->pcPages);
+    free(s);
+}
@@ -0,0 +1,55 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef MEMSIM_INC
+#define MEMSIM_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Most cache levels which can be simulated
+#define MEMSIM_LEVELS 4
+
+// Kinds of memory accesses
+enum {
+    MEMSIM_FETCH,   // Instruction fetch
+    MEMSIM_LOAD,    // Load
+    MEMSIM_STORE,   // Store, compare and swap or atomic add
+    MEMSIM_KINDS
+};
+
+// Geometry of each cache level, in bytes
+typedef struct {
+    int levels;
+    struct {
+        uint64_t size;
+        uint32_t ways;
+        uint32_t line;
+    } level[MEMSIM_LEVELS];
+} memSimConfig;
+
+typedef struct memSim memSim;
+
+// Parses a comma-separated list of levels, from closest to
+// farthest, each given as size:ways:line in bytes (size may
+// have a K or M suffix), as in "32K:8:64,256K:8:64". Every
+// level must have a power of two number of sets and a power
+// of two line size of at least 4 bytes. Returns false if the
+// spec is invalid.
+bool memSimParse(const char *spec, memSimConfig *cfg);
+
+// Creates a simulator for a memory of memory_size words.
+// Returns NULL if it could not be allocated.
+memSim *memSimOpen(const memSimConfig *cfg, uint32_t memory_size);
+
+// Simulates an access to the word at addr by the
+// instruction at pc. Both are physical addresses.
+void memSimAccess(memSim *s, uint32_t pc, uint32_t addr, int kind);
+
+// Writes a report to stderr
+void memSimReport(memSim *s);
+
+void memSimClose(memSim *s);
+
+#endif
@@ -0,0 +1,193 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// For F_SETSIG and si_fd
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+
+// Counted hardware events
+enum {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    CACHE_MISSES,
+    EVENTS
+};
+
+static const struct {
+    const char *name;
+    uint64_t config;
+    uint64_t period;    // Events between samples
+} events[EVENTS] = {
+    {"cycles",        PERF_COUNT_HW_CPU_CYCLES,    1000000},
+    {"instructions",  PERF_COUNT_HW_INSTRUCTIONS,  1000000},
+    {"branch misses", PERF_COUNT_HW_BRANCH_MISSES, 10000},
+    {"cache misses",  PERF_COUNT_HW_CACHE_MISSES,  10000}
+};
+
+volatile sig_atomic_t perfOp;
+
+// Counting group, led by cycles
+static int counters[EVENTS];
+
+// Sampling events, one per counted event
+static int samplers[EVENTS];
+static bool sampling;
+
+// Samples attributed to each op code
+static volatile uint64_t samples[EVENTS][PERF_OPS];
+
+int openEvent(int event, int group, bool sample);
+void closeEvents(void);
+void onSample(int sig, siginfo_t *info, void *ctx);
+
+int openEvent(int event, int group, bool sample) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = events[event].config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if (sample) {
+        attr.sample_period = events[event].period;
+    } else {
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+void closeEvents(void) {
+    for (int i = 0; i < EVENTS; i++) {
+        if (counters[i] >= 0)
+            close(counters[i]);
+        if (samplers[i] >= 0)
+            close(samplers[i]);
+        counters[i] = samplers[i] = -1;
+    }
+}
+
+// Attributes one sampling period to the current
+// op code and rearms the event for the next one
+void onSample(int sig, siginfo_t *info, void *ctx) {
+    (void)sig;
+    (void)ctx;
+    for (int i = 0; i < EVENTS; i++) {
+        if (samplers[i] == info->si_fd) {
+            samples[i][perfOp & (PERF_OPS - 1)] += events[i].period;
+            ioctl(samplers[i], PERF_EVENT_IOC_REFRESH, 1);
+            return;
+        }
+    }
+}
+
+bool perfStart(bool opcodes) {
+    for (int i = 0; i < EVENTS; i++)
+        counters[i] = samplers[i] = -1;
+
+    for (int i = 0; i < EVENTS; i++) {
+        counters[i] = openEvent(i, i == 0 ? -1 : counters[0], false);
+        if (counters[i] < 0) {
+            fprintf(stderr, "Performance counters unavailable: %s\n", strerror(errno));
+            closeEvents();
+            return false;
+        }
+    }
+
+    sampling = opcodes;
+    if (sampling) {
+        memset((void*)samples, 0, sizeof(samples));
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onSample;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigaction(SIGIO, &sa, NULL);
+
+        // Each overflow raises SIGIO, with the
+        // event's descriptor in si_fd
+        for (int i = 0; i < EVENTS; i++) {
+            samplers[i] = openEvent(i, -1, true);
+            if (samplers[i] < 0 ||
+                fcntl(samplers[i], F_SETFL, O_ASYNC) != 0 ||
+                fcntl(samplers[i], F_SETSIG, SIGIO) != 0 ||
+                fcntl(samplers[i], F_SETOWN, getpid()) != 0) {
+                fprintf(stderr, "Performance sampling unavailable: %s\n", strerror(errno));
+                closeEvents();
+                return false;
+            }
+        }
+        for (int i = 0; i < EVENTS; i++)
+            ioctl(samplers[i], PERF_EVENT_IOC_REFRESH, 1);
+    }
+
+    ioctl(counters[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void perfStop(uint64_t retired) {
+    ioctl(counters[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int i = 0; i < EVENTS; i++) {
+        if (samplers[i] >= 0)
+            ioctl(samplers[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // Group read: count, time enabled, time running, values
+    uint64_t values[3 + EVENTS];
+    if (read(counters[0], values, sizeof(values)) != sizeof(values)) {
+        fprintf(stderr, "Could not read performance counters\n");
+        closeEvents();
+        return;
+    }
+
+    // Scale up if the group was multiplexed
+    // with other events and did not always run
+    double scale = 1.0;
+    if (values[2] != 0 && values[2] < values[1])
+        scale = (double)values[1] / values[2];
+
+    fprintf(stderr, "\n---\nGuest instructions: %llu\n", (unsigned long long)retired);
+    for (int i = 0; i < EVENTS; i++) {
+        double count = values[3 + i] * scale;
+        fprintf(stderr, "Host %s: %.0f (%.2f per guest instruction)\n",
+                events[i].name, count, retired != 0 ? count / retired : 0.0);
+    }
+
+    if (sampling) {
+        fprintf(stderr, "\nSampled per op code:\n%6s", "op");
+        for (int i = 0; i < EVENTS; i++)
+            fprintf(stderr, " %15s", events[i].name);
+        fprintf(stderr, "\n");
+        for (int op = 0; op < PERF_OPS; op++) {
+            bool any = false;
+            for (int i = 0; i < EVENTS; i++)
+                any = any || samples[i][op] != 0;
+            if (!any)
+                continue;
+            fprintf(stderr, "%6d", op);
+            for (int i = 0; i < EVENTS; i++)
+                fprintf(stderr, " %15llu", (unsigned long long)samples[i][op]);
+            fprintf(stderr, "\n");
+        }
+        signal(SIGIO, SIG_DFL);
+    }
+
+    closeEvents();
+}
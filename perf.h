@@ -0,0 +1,30 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PERF_INC
+#define PERF_INC
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+
+// Number of possible op codes (six bits)
+#define PERF_OPS 64
+
+// Op code of the instruction being executed,
+// which samples are attributed to
+extern volatile sig_atomic_t perfOp;
+
+// Starts counting host cycles, instructions, branch
+// misses and cache misses with perf_event_open. If
+// opcodes is set, the counters are also sampled and
+// each sample is attributed to perfOp. Returns false
+// (and prints why) if the counters are unavailable.
+bool perfStart(bool opcodes);
+
+// Stops counting and reports the counts to stderr,
+// relative to the number of guest instructions retired
+void perfStop(uint64_t retired);
+
+#endif
@@ -0,0 +1,192 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+// Shortest window over which the
+// rate is measured, in nanoseconds
+#define RATE_WINDOW 100000000ULL
+
+struct statsRegion {
+    machineStats *stats;    // Mapped region
+    int fd;                 // Backing file, or -1
+
+    // Start of the current rate window
+    uint64_t windowStart;
+    uint64_t windowRetired;
+};
+
+// Region written by the SIGUSR1 handler
+static statsRegion *activeStats;
+
+// Handler in place before statsOpen, restored by statsClose
+static struct sigaction oldUsr1;
+
+uint64_t nanotime(clockid_t clock);
+void onStatsSignal(int sig);
+char *appendString(char *p, const char *s);
+char *appendUint(char *p, uint64_t n);
+
+uint64_t nanotime(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+char *appendString(char *p, const char *s) {
+    while (*s != '\0')
+        *p++ = *s++;
+    return p;
+}
+
+char *appendUint(char *p, uint64_t n) {
+    char digits[20];
+    int i = 0;
+    do {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    while (i > 0)
+        *p++ = digits[--i];
+    return p;
+}
+
+// Writes the latest statistics to stderr. This runs
+// in a signal handler, so it formats by hand and only
+// calls write. It may have interrupted an update, so
+// it gives up on a consistent copy after a few tries.
+void onStatsSignal(int sig) {
+    (void)sig;
+    if (activeStats == NULL)
+        return;
+
+    machineStats s;
+    for (int tries = 0; tries < 3; tries++) {
+        uint32_t seq = activeStats->stats->seq;
+        memcpy(&s, activeStats->stats, sizeof(s));
+        if (seq % 2 == 0 && seq == activeStats->stats->seq)
+            break;
+    }
+
+    char buf[1024];
+    char *p = buf;
+    p = appendString(p, "\n---\nInstructions: ");
+    p = appendUint(p, s.retired);
+    p = appendString(p, "\nInstructions per second: ");
+    p = appendUint(p, s.ips);
+    p = appendString(p, "\nMode switches: ");
+    p = appendUint(p, s.modeSwitches);
+    p = appendString(p, "\nFaults by code:");
+    for (int i = 0; i < STATS_FAULTS; i++) {
+        p = appendString(p, " ");
+        p = appendUint(p, s.faults[i]);
+    }
+    p = appendString(p, "\nOutput bytes: ");
+    p = appendUint(p, s.outBytes);
+    p = appendString(p, "\nInput bytes: ");
+    p = appendUint(p, s.inBytes);
+    p = appendString(p, "\nProgram counter: ");
+    p = appendUint(p, s.pc);
+    p = appendString(p, "\nTimer: ");
+    p = appendUint(p, s.timer);
+    p = appendString(p, s.waiting ? "\nWaiting for input\n" : "\n");
+    write(STDERR_FILENO, buf, p - buf);
+}
+
+statsRegion *statsOpen(const char *path) {
+    statsRegion *r = (statsRegion*)calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+
+    r->fd = -1;
+    void *mem;
+    if (path != NULL) {
+        r->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (r->fd < 0 || ftruncate(r->fd, sizeof(machineStats)) != 0) {
+            if (r->fd >= 0)
+                close(r->fd);
+            free(r);
+            return NULL;
+        }
+        mem = mmap(NULL, sizeof(machineStats), PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    } else {
+        mem = malloc(sizeof(machineStats));
+        if (mem == NULL)
+            mem = MAP_FAILED;
+    }
+    if (mem == MAP_FAILED) {
+        if (r->fd >= 0)
+            close(r->fd);
+        free(r);
+        return NULL;
+    }
+
+    r->stats = (machineStats*)mem;
+    memset(r->stats, 0, sizeof(*(r->stats)));
+    r->stats->magic = STATS_MAGIC;
+    r->stats->version = STATS_VERSION;
+    r->stats->pid = (uint32_t)getpid();
+    r->stats->updated = nanotime(CLOCK_REALTIME);
+    r->windowStart = nanotime(CLOCK_MONOTONIC);
+
+    activeStats = r;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStatsSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, &oldUsr1);
+    return r;
+}
+
+void statsPublish(statsRegion *r, const machineStats *s) {
+    machineStats *dst = r->stats;
+
+    uint64_t now = nanotime(CLOCK_MONOTONIC);
+    uint64_t ips = dst->ips;
+    if (now - r->windowStart >= RATE_WINDOW) {
+        ips = (s->retired - r->windowRetired) * 1000000000ULL / (now - r->windowStart);
+        r->windowStart = now;
+        r->windowRetired = s->retired;
+    }
+
+    dst->seq++;
+    __sync_synchronize();
+    dst->updated = nanotime(CLOCK_REALTIME);
+    dst->retired = s->retired;
+    dst->ips = ips;
+    dst->modeSwitches = s->modeSwitches;
+    memcpy(dst->faults, s->faults, sizeof(dst->faults));
+    dst->outBytes = s->outBytes;
+    dst->inBytes = s->inBytes;
+    dst->pc = s->pc;
+    dst->timer = s->timer;
+    dst->waiting = s->waiting;
+    __sync_synchronize();
+    dst->seq++;
+}
+
+void statsClose(statsRegion *r) {
+    if (activeStats == r) {
+        sigaction(SIGUSR1, &oldUsr1, NULL);
+        activeStats = NULL;
+    }
+    if (r->fd >= 0) {
+        munmap(r->stats, sizeof(*(r->stats)));
+        close(r->fd);
+    } else {
+        free(r->stats);
+    }
+    free(r);
+}
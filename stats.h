@@ -0,0 +1,61 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef STATS_INC
+#define STATS_INC
+
+#include <stdint.h>
+
+// Identifies a statistics file. It is written
+// in host byte order, like the rest of the file.
+#define STATS_MAGIC   0x4D535441
+#define STATS_VERSION 1
+
+// Instructions between publications (a power of two)
+#define STATS_INTERVAL 65536
+
+// Number of fault codes; machine.c checks
+// that this matches its fault enumeration
+#define STATS_FAULTS 7
+
+// Statistics of a running machine. Readers should copy
+// the struct and retry if seq was odd or changed during
+// the copy, since the writer increments it before and
+// after every update.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t seq;
+    uint32_t pid;
+    uint64_t updated;       // Wall clock time of the last
+                            //   update, in ns since the epoch
+    uint64_t retired;       // Instructions executed
+    uint64_t ips;           // Recent instructions per second
+    uint64_t modeSwitches;  // Entries into user mode and faults
+    uint64_t faults[STATS_FAULTS]; // Faults by fault code
+    uint64_t outBytes;      // Bytes written by Output
+    uint64_t inBytes;       // Bytes read by Input
+    uint32_t pc;            // Physical address of the
+                            //   instruction being executed
+    uint32_t timer;         // Program counter timer
+    uint32_t waiting;       // Nonzero while blocked on input
+    uint32_t unused;
+} machineStats;
+
+typedef struct statsRegion statsRegion;
+
+// Creates the region statistics are published to. If
+// path is not NULL, it is a file mapped shared so that
+// other processes can read it. On SIGUSR1, the latest
+// statistics are written to stderr. Returns NULL if
+// the region could not be created.
+statsRegion *statsOpen(const char *path);
+
+// Publishes a snapshot of the counters. Only the counters
+// are read from s; the header and rate are filled in.
+void statsPublish(statsRegion *r, const machineStats *s);
+
+void statsClose(statsRegion *r);
+
+#endif
@@ -0,0 +1,112 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Signals which dump the trace and then take
+// their default action; SIGUSR2 only dumps
+static const int fatalSignals[] = {SIGINT, SIGTERM, SIGQUIT, SIGSEGV, SIGBUS, SIGABRT};
+#define FATAL_SIGNALS (sizeof(fatalSignals) / sizeof(*fatalSignals))
+
+// Buffer dumped by the signal handler
+static traceBuffer *activeTrace;
+
+// Handlers in place before traceOpen, restored by traceClose
+static struct sigaction oldUsr2;
+static struct sigaction oldFatal[FATAL_SIGNALS];
+
+void onTraceSignal(int sig);
+void setTraceHandlers(void);
+void restoreTraceHandlers(void);
+
+void onTraceSignal(int sig) {
+    if (activeTrace != NULL)
+        traceDump(activeTrace);
+    if (sig == SIGUSR2)
+        return;
+    // The handler was reset to the default action on
+    // entry, so this takes effect once the handler returns
+    raise(sig);
+}
+
+void setTraceHandlers(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onTraceSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, &oldUsr2);
+
+    sa.sa_flags = SA_RESTART | SA_RESETHAND;
+    for (size_t i = 0; i < FATAL_SIGNALS; i++)
+        sigaction(fatalSignals[i], &sa, &oldFatal[i]);
+}
+
+void restoreTraceHandlers(void) {
+    sigaction(SIGUSR2, &oldUsr2, NULL);
+    for (size_t i = 0; i < FATAL_SIGNALS; i++)
+        sigaction(fatalSignals[i], &oldFatal[i], NULL);
+}
+
+traceBuffer *traceOpen(const char *path, uint32_t records) {
+    uint32_t size = 1;
+    while (size < records && size < (1U << 31))
+        size <<= 1;
+
+    traceBuffer *t = (traceBuffer*)malloc(sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->records = (traceRecord*)calloc(size, sizeof(*(t->records)));
+    if (t->records == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->mask = size - 1;
+    t->next = 0;
+    t->path = path;
+
+    activeTrace = t;
+    setTraceHandlers();
+    return t;
+}
+
+void traceDump(traceBuffer *t) {
+    int fd = open(t->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    uint64_t size = (uint64_t)t->mask + 1;
+    uint64_t next = t->next;
+    traceHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = TRACE_MAGIC;
+    h.version = TRACE_VERSION;
+    h.written = next;
+    h.count = (uint32_t)(next < size ? next : size);
+
+    // Once the ring has wrapped, the oldest
+    // record is the one which is next overwritten
+    uint32_t oldest = next < size ? 0 : (uint32_t)(next & t->mask);
+    if (write(fd, &h, sizeof(h)) == sizeof(h) &&
+        write(fd, t->records + oldest, (h.count - oldest) * sizeof(traceRecord)) >= 0)
+        write(fd, t->records, oldest * sizeof(traceRecord));
+    close(fd);
+}
+
+void traceClose(traceBuffer *t) {
+    if (activeTrace == t) {
+        restoreTraceHandlers();
+        activeTrace = NULL;
+    }
+    free(t->records);
+    free(t);
+}
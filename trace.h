@@ -0,0 +1,84 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TRACE_INC
+#define TRACE_INC
+
+#include <stdint.h>
+
+// Identifies a trace file. It is written in host
+// byte order, which the decoder detects from it.
+#define TRACE_MAGIC   0x4D545243
+#define TRACE_VERSION 1
+
+// Default number of records kept
+#define TRACE_RECORDS 65536
+
+// Kinds of trace records
+enum {
+    TRACE_EXEC,     // Executed word at pc; value is the timer
+    TRACE_MEM,      // Accessed physical address word; value
+                    //   is the address before translation
+    TRACE_FAULT,    // Fault with code word at pc; value
+                    //   is the callback
+    TRACE_UMODE,    // Entered user mode at pc; word and
+                    //   value are the virtual memory bounds
+    TRACE_END       // Machine stopped at pc in state word
+};
+
+// Flags of trace records
+#define TRACE_USER 1    // Machine was in user mode
+
+typedef struct {
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t unused;
+    uint32_t pc;
+    uint32_t word;
+    uint32_t value;
+} traceRecord;
+
+// A trace file is this header followed by the records
+// of the ring buffer, oldest first
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t written;   // Records written in total
+    uint32_t count;     // Records in the file
+    uint32_t unused;
+} traceHeader;
+
+// A fixed-size ring of the most recent records
+typedef struct {
+    traceRecord *records;
+    uint32_t mask;      // Number of records - 1
+    uint64_t next;      // Records written in total
+    const char *path;   // Where to dump the records
+} traceBuffer;
+
+// Allocates a buffer of at least the given number of
+// records (rounded up to a power of two) and dumps it to
+// path on SIGUSR2 and on fatal signals. Returns NULL if
+// it could not be allocated.
+traceBuffer *traceOpen(const char *path, uint32_t records);
+
+// Writes the buffer to its path. Only uses async-signal-safe
+// calls so that it can be called from a signal handler.
+void traceDump(traceBuffer *t);
+
+void traceClose(traceBuffer *t);
+
+// Appends a record, overwriting the oldest one if full
+static inline void traceAdd(traceBuffer *t, uint8_t kind, uint8_t flags,
+                            uint32_t pc, uint32_t word, uint32_t value) {
+    traceRecord *r = &t->records[t->next & t->mask];
+    r->kind = kind;
+    r->flags = flags;
+    r->pc = pc;
+    r->word = word;
+    r->value = value;
+    t->next++;
+}
+
+#endif
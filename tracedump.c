@@ -0,0 +1,136 @@
+// Copyright 2013 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Decodes a trace file written by machine -t into text
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace.h"
+
+// Exit codes
+#define NORMAL   0
+#define USAGE    1
+#define FILEIO   2
+
+// Names of op codes, in op code order
+static const char *opNames[] = {
+    "move", "eq", "gt", "sgt", "lt", "slt", "cjmp", "load", "store",
+    "add", "sub", "mult", "smult", "divide", "sdiv", "and", "or", "xor",
+    "not", "lshift", "rshift", "cas", "aadd", "hlt", "out", "in", "lval",
+    "umode", "lload", "lstore", "scall", "fmove", "pclload", "svmlow",
+    "svmhi", "tload", "tstore", "trg"
+};
+#define OPS (sizeof(opNames) / sizeof(*opNames))
+#define LVAL 26
+
+// Names of fault codes, in fault code order
+static const char *faultNames[] = {
+    "protected instruction", "trigger", "timer expired",
+    "memory outside virtual memory", "instruction outside virtual memory",
+    "invalid instruction", "division by zero"
+};
+#define FAULTS (sizeof(faultNames) / sizeof(*faultNames))
+
+// Names of machine states, in state order
+static const char *stateNames[] = {"run", "halt", "fail", "mem", "intern"};
+#define STATES (sizeof(stateNames) / sizeof(*stateNames))
+
+uint32_t swap32(uint32_t x);
+void printRecord(uint64_t n, traceRecord *r);
+
+uint32_t swap32(uint32_t x) {
+    return (x >> 24) | ((x >> 8) & 0xFF00) | ((x << 8) & 0xFF0000) | (x << 24);
+}
+
+void printRecord(uint64_t n, traceRecord *r) {
+    printf("%10llu %s pc=%08x ", (unsigned long long)n,
+           r->flags & TRACE_USER ? "user  " : "kernel", r->pc);
+    switch (r->kind) {
+        case TRACE_EXEC: {
+            uint32_t op = r->word >> 26;
+            printf("exec  %08x ", r->word);
+            if (op >= OPS)
+                printf("(invalid)");
+            else if (op == LVAL)
+                printf("%-7s r%u, %u", opNames[op], (r->word >> 22) & 0xF, r->word & 0x3FFFFF);
+            else
+                printf("%-7s r%u, r%u, r%u", opNames[op],
+                       (r->word >> 8) & 0xF, (r->word >> 4) & 0xF, r->word & 0xF);
+            printf("  timer=%u\n", r->value);
+            break;
+        }
+        case TRACE_MEM:
+            printf("mem   addr=%08x logical=%08x\n", r->word, r->value);
+            break;
+        case TRACE_FAULT:
+            printf("fault %u (%s) callback=%08x\n", r->word,
+                   r->word < FAULTS ? faultNames[r->word] : "unknown", r->value);
+            break;
+        case TRACE_UMODE:
+            printf("umode vm=[%08x, %08x]\n", r->word, r->value);
+            break;
+        case TRACE_END:
+            printf("end   state=%s\n", r->word < STATES ? stateNames[r->word] : "unknown");
+            break;
+        default:
+            printf("unknown record kind %u\n", r->kind);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace>\n", argv[0]);
+        return USAGE;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file: %s\n", argv[1]);
+        return FILEIO;
+    }
+
+    // A trace written on a host of the other
+    // endianness has a byte-swapped magic number
+    traceHeader h;
+    bool swap = false;
+    if (fread(&h, sizeof(h), 1, f) != 1) {
+        fprintf(stderr, "Truncated trace: %s\n", argv[1]);
+        fclose(f);
+        return FILEIO;
+    }
+    if (h.magic == swap32(TRACE_MAGIC)) {
+        swap = true;
+        h.version = swap32(h.version);
+        h.count = swap32(h.count);
+        h.written = ((uint64_t)swap32((uint32_t)h.written) << 32) | swap32((uint32_t)(h.written >> 32));
+    } else if (h.magic != TRACE_MAGIC) {
+        fprintf(stderr, "Not a trace: %s\n", argv[1]);
+        fclose(f);
+        return FILEIO;
+    }
+    if (h.version != TRACE_VERSION) {
+        fprintf(stderr, "Unsupported trace version %u: %s\n", h.version, argv[1]);
+        fclose(f);
+        return FILEIO;
+    }
+
+    printf("%llu records written, last %u kept\n", (unsigned long long)h.written, h.count);
+
+    // Number records by their position in the whole run
+    uint64_t n = h.written - h.count;
+    traceRecord r;
+    for (uint32_t i = 0; i < h.count && fread(&r, sizeof(r), 1, f) == 1; i++) {
+        if (swap) {
+            r.pc = swap32(r.pc);
+            r.word = swap32(r.word);
+            r.value = swap32(r.value);
+        }
+        printRecord(n++, &r);
+    }
+
+    fclose(f);
+    return NORMAL;
+}